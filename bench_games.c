@@ -0,0 +1,119 @@
+#include <SDL2/SDL.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "games.h"
+
+#define BENCH_GAMES     100000
+#define BENCH_VISIBLE   8
+#define BENCH_ROUNDS    1000
+
+const char *words[] = {
+    "Super", "Street", "Fighter", "Mario", "Sonic", "Metal", "Slug",
+    "King", "of", "Fighters", "Éclair", "Zelda", "Castlevania", "Ōkami",
+    "Puzzle", "Bobble", "Final", "Fantasy", "Résistance", "Tetris",
+};
+
+int title_compare(const void *a, const void *b) {
+    return strcoll(*(const char **) a, *(const char **) b);
+}
+
+double now() {
+    return (double) SDL_GetPerformanceCounter() * 1000 / SDL_GetPerformanceFrequency();
+}
+
+int main(int argc, char **argv) {
+    struct game_list *list = game_list_new();
+    char title[GAME_TITLE_LENGTH];
+    const char **titles;
+    double start, elapsed;
+    volatile int sink = 0;
+    int order = SORT_TITLE;
+
+    setlocale(LC_COLLATE, "");
+    srand(42);
+
+    /* Generate random games */
+    start = now();
+    for (int i=0; i<BENCH_GAMES; i++) {
+        snprintf(title, sizeof(title), "%s %s %s %d",
+                words[rand() % SDL_arraysize(words)],
+                words[rand() % SDL_arraysize(words)],
+                words[rand() % SDL_arraysize(words)],
+                rand() % 100);
+        game_list_load(list, title, 1980 + rand() % 40, rand() % 50, rand());
+    }
+    printf("Collation keys : %.2f ms for %d games\n", now() - start, BENCH_GAMES);
+
+    /* Initial sort of every order */
+    start = now();
+    game_list_sort(list);
+    printf("Initial sort : %.2f ms (%d cores)\n", now() - start, SDL_GetCPUCount());
+
+    /* Toggle orders and read the visible games */
+    start = now();
+    for (int i=0; i<BENCH_ROUNDS; i++) {
+        order = (order + 1) % SORT_COUNT;
+        for (int j=0; j<BENCH_VISIBLE; j++)
+            sink += game_list_at(list, order, j)->year;
+    }
+    elapsed = now() - start;
+    printf("Toggle : %.3f us\n", elapsed * 1000 / BENCH_ROUNDS);
+
+    /* What a toggle would cost without the precomputed orders */
+    titles = malloc(list->count * sizeof(char *));
+    if (!titles) {
+        printf("Error main : out of memory\n");
+        return 1;
+    }
+    for (int i=0; i<list->count; i++)
+        titles[i] = list->games[i].title;
+
+    start = now();
+    qsort(titles, list->count, sizeof(char *), title_compare);
+    printf("Toggle by re-sorting, qsort with strcoll : %.2f ms\n", now() - start);
+    free(titles);
+
+    start = now();
+    game_list_sort(list);
+    printf("Toggle by re-sorting, game_list_sort : %.2f ms\n", now() - start);
+
+    /* Bump play counts */
+    start = now();
+    for (int i=0; i<BENCH_ROUNDS; i++)
+        game_list_played(list, rand() % list->count);
+    elapsed = now() - start;
+    printf("Play count bump : %.3f us\n", elapsed * 1000 / BENCH_ROUNDS);
+
+    /* Add games */
+    start = now();
+    for (int i=0; i<BENCH_ROUNDS; i++) {
+        snprintf(title, sizeof(title), "%s %d", words[rand() % SDL_arraysize(words)], i);
+        game_list_add(list, title, 1980 + rand() % 40, 0, RAND_MAX + (Uint64) i);
+    }
+    elapsed = now() - start;
+    printf("Game add : %.3f us\n", elapsed * 1000 / BENCH_ROUNDS);
+
+    /* Check every order is still sorted */
+    for (int i=0; i<SORT_COUNT; i++) {
+        for (int j=1; j<list->count; j++) {
+            struct game *a = game_list_at(list, i, j - 1);
+            struct game *b = game_list_at(list, i, j);
+
+            if ((i == SORT_YEAR && a->year > b->year)
+                    || (i == SORT_MOST_PLAYED && a->play_count < b->play_count)
+                    || (i == SORT_RECENTLY_ADDED && a->added < b->added)
+                    || (i == SORT_TITLE && strcoll(a->title, b->title) > 0)
+                    || list->rank[i][list->index[i][j]] != j) {
+                printf("Error order %d broken at %d\n", i, j);
+                return 1;
+            }
+        }
+    }
+
+    game_list_free(list);
+
+    return 0;
+}
@@ -0,0 +1,805 @@
+#include <SDL2/SDL.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "hashmap/hashmap.h"
+#include "checksum.h"
+
+/* Files are mapped one window at a time, and hashed one slice at a time
+ * so cancellation is noticed quickly even on slow storage */
+#define CHECKSUM_WINDOW (64 * 1024 * 1024)
+#define CHECKSUM_SLICE  (1024 * 1024)
+
+static struct hashmap *checksum_map;
+static SDL_mutex *checksum_lock;
+static SDL_atomic_t checksum_cancel;
+
+/* Set while a thread reads a mapped file, a file truncated meanwhile
+ * raises SIGBUS which jumps back here instead of crashing */
+static __thread sigjmp_buf *checksum_jump;
+
+/*********/
+/* CRC32 */
+/*********/
+static Uint32 crc32_table[8][256];
+
+#if defined(__x86_64__) || defined(__i386__)
+static char crc32_pclmul_supported;
+
+/* Fold 64 bytes at a time with carry-less multiplications, length is a
+ * multiple of 16 and at least 64 (Intel, "Fast CRC Computation Using
+ * PCLMULQDQ Instruction") */
+__attribute__((target("pclmul,sse4.1")))
+static Uint32 crc32_pclmul(Uint32 crc, const unsigned char *data, size_t length) {
+    const Uint64 k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    const Uint64 k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    const Uint64 k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    const Uint64 poly[] = { 0x01db710641, 0x01f7011641 };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((__m128i *) (data + 0x00));
+    x2 = _mm_loadu_si128((__m128i *) (data + 0x10));
+    x3 = _mm_loadu_si128((__m128i *) (data + 0x20));
+    x4 = _mm_loadu_si128((__m128i *) (data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_loadu_si128((__m128i *) k1k2);
+
+    data += 64;
+    length -= 64;
+
+    /* Fold by 4 */
+    while (length >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((__m128i *) (data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((__m128i *) (data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((__m128i *) (data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((__m128i *) (data + 0x30)));
+
+        data += 64;
+        length -= 64;
+    }
+
+    /* Fold into 128 bits */
+    x0 = _mm_loadu_si128((__m128i *) k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Fold remaining 16 bytes blocks */
+    while (length >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((__m128i *) data)), x5);
+
+        data += 16;
+        length -= 16;
+    }
+
+    /* Fold 128 bits into 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x0 = _mm_loadl_epi64((__m128i *) k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = _mm_loadu_si128((__m128i *) poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return _mm_extract_epi32(x1, 1);
+}
+#endif
+
+static void crc32_init() {
+    Uint32 crc;
+
+    for (int i=0; i<256; i++) {
+        crc = i;
+        for (int j=0; j<8; j++)
+            crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+        crc32_table[0][i] = crc;
+    }
+
+    for (int i=0; i<256; i++) {
+        for (int j=1; j<8; j++)
+            crc32_table[j][i] = (crc32_table[j - 1][i] >> 8) ^ crc32_table[0][crc32_table[j - 1][i] & 0xff];
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    crc32_pclmul_supported = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+static Uint32 crc32_update(Uint32 crc, const unsigned char *data, size_t length) {
+    Uint32 low, high;
+
+    crc = ~crc;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (crc32_pclmul_supported && length >= 64) {
+        size_t blocks = length & ~(size_t) 15;
+
+        crc = crc32_pclmul(crc, data, blocks);
+        data += blocks;
+        length -= blocks;
+    }
+#elif defined(__ARM_FEATURE_CRC32)
+    for (; length >= 8; data += 8, length -= 8) {
+        Uint64 word;
+
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32d(crc, word);
+    }
+#endif
+
+    /* Slice-by-8 */
+    for (; length >= 8; data += 8, length -= 8) {
+        memcpy(&low, data, sizeof(low));
+        memcpy(&high, data + 4, sizeof(high));
+        low = SDL_SwapLE32(low) ^ crc;
+        high = SDL_SwapLE32(high);
+
+        crc = crc32_table[7][low & 0xff] ^ crc32_table[6][(low >> 8) & 0xff]
+            ^ crc32_table[5][(low >> 16) & 0xff] ^ crc32_table[4][low >> 24]
+            ^ crc32_table[3][high & 0xff] ^ crc32_table[2][(high >> 8) & 0xff]
+            ^ crc32_table[1][(high >> 16) & 0xff] ^ crc32_table[0][high >> 24];
+    }
+
+    for (; length > 0; data++, length--)
+        crc = (crc >> 8) ^ crc32_table[0][(crc ^ *data) & 0xff];
+
+    return ~crc;
+}
+
+/********/
+/* SHA1 */
+/********/
+struct sha1 {
+    Uint32 state[5];
+    Uint64 length;
+    unsigned char buffer[64];
+};
+
+#define ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+/* One loop per round function so the compiler can unroll them */
+#define SHA1_ROUND(start, end, f, k) \
+    for (int i=start; i<end; i++) { \
+        temp = ROL(a, 5) + (f) + e + k + w[i]; \
+        e = d; \
+        d = c; \
+        c = ROL(b, 30); \
+        b = a; \
+        a = temp; \
+    }
+
+static void sha1_block(Uint32 state[5], const unsigned char *block) {
+    Uint32 w[80];
+    Uint32 a, b, c, d, e, temp;
+
+    for (int i=0; i<16; i++)
+        w[i] = (Uint32) block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+
+    for (int i=16; i<80; i++)
+        w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+
+    SHA1_ROUND(0, 20, (b & c) | (~b & d), 0x5a827999);
+    SHA1_ROUND(20, 40, b ^ c ^ d, 0x6ed9eba1);
+    SHA1_ROUND(40, 60, (b & c) | (b & d) | (c & d), 0x8f1bbcdc);
+    SHA1_ROUND(60, 80, b ^ c ^ d, 0xca62c1d6);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static char sha1_ni_supported;
+
+/* Four rounds with the SHA extensions, message words m0 are consumed while
+ * the schedule of the following ones is advanced */
+#define SHA1_NI_ROUNDS(e_in, e_out, m0, m1, m2, m3, f) \
+    e_in = _mm_sha1nexte_epu32(e_in, m0); \
+    e_out = abcd; \
+    m1 = _mm_sha1msg2_epu32(m1, m0); \
+    abcd = _mm_sha1rnds4_epu32(abcd, e_in, f); \
+    m3 = _mm_sha1msg1_epu32(m3, m0); \
+    m2 = _mm_xor_si128(m2, m0);
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha1_ni(Uint32 state[5], const unsigned char *data, size_t blocks) {
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcd_save, e0, e0_save, e1;
+    __m128i m0, m1, m2, m3;
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *) state), 0x1b);
+    e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+    for (; blocks > 0; data += 64, blocks--) {
+        abcd_save = abcd;
+        e0_save = e0;
+
+        /* Rounds 0 to 11, while the message is loaded */
+        m0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (data + 0x00)), mask);
+        e0 = _mm_add_epi32(e0, m0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        m1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (data + 0x10)), mask);
+        e1 = _mm_sha1nexte_epu32(e1, m1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        m0 = _mm_sha1msg1_epu32(m0, m1);
+
+        m2 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (data + 0x20)), mask);
+        e0 = _mm_sha1nexte_epu32(e0, m2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        m1 = _mm_sha1msg1_epu32(m1, m2);
+        m0 = _mm_xor_si128(m0, m2);
+
+        /* Rounds 12 to 79 */
+        m3 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (data + 0x30)), mask);
+        SHA1_NI_ROUNDS(e1, e0, m3, m0, m1, m2, 0);
+        SHA1_NI_ROUNDS(e0, e1, m0, m1, m2, m3, 0);
+        SHA1_NI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+        SHA1_NI_ROUNDS(e0, e1, m2, m3, m0, m1, 1);
+        SHA1_NI_ROUNDS(e1, e0, m3, m0, m1, m2, 1);
+        SHA1_NI_ROUNDS(e0, e1, m0, m1, m2, m3, 1);
+        SHA1_NI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+        SHA1_NI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+        SHA1_NI_ROUNDS(e1, e0, m3, m0, m1, m2, 2);
+        SHA1_NI_ROUNDS(e0, e1, m0, m1, m2, m3, 2);
+        SHA1_NI_ROUNDS(e1, e0, m1, m2, m3, m0, 2);
+        SHA1_NI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+        SHA1_NI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+        SHA1_NI_ROUNDS(e0, e1, m0, m1, m2, m3, 3);
+        SHA1_NI_ROUNDS(e1, e0, m1, m2, m3, m0, 3);
+        SHA1_NI_ROUNDS(e0, e1, m2, m3, m0, m1, 3);
+        SHA1_NI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = _mm_extract_epi32(e0, 3);
+}
+#endif
+
+static void sha1_blocks(Uint32 state[5], const unsigned char *data, size_t blocks) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (sha1_ni_supported) {
+        sha1_ni(state, data, blocks);
+        return;
+    }
+#endif
+
+    for (; blocks > 0; data += 64, blocks--)
+        sha1_block(state, data);
+}
+
+static void sha1_init(struct sha1 *sha1) {
+    sha1->state[0] = 0x67452301;
+    sha1->state[1] = 0xefcdab89;
+    sha1->state[2] = 0x98badcfe;
+    sha1->state[3] = 0x10325476;
+    sha1->state[4] = 0xc3d2e1f0;
+    sha1->length = 0;
+}
+
+static void sha1_update(struct sha1 *sha1, const unsigned char *data, size_t length) {
+    size_t used = sha1->length % 64;
+
+    sha1->length += length;
+
+    /* Complete the pending block */
+    if (used) {
+        size_t missing = 64 - used;
+
+        if (length < missing) {
+            memcpy(sha1->buffer + used, data, length);
+            return;
+        }
+
+        memcpy(sha1->buffer + used, data, missing);
+        sha1_blocks(sha1->state, sha1->buffer, 1);
+        data += missing;
+        length -= missing;
+    }
+
+    sha1_blocks(sha1->state, data, length / 64);
+    memcpy(sha1->buffer, data + length / 64 * 64, length % 64);
+}
+
+static void sha1_final(struct sha1 *sha1, unsigned char digest[20]) {
+    unsigned char padding[72] = { 0x80 };
+    Uint64 bits = sha1->length * 8;
+    size_t used = sha1->length % 64;
+    size_t count = (used < 56 ? 56 : 120) - used;
+
+    for (int i=0; i<8; i++)
+        padding[count + i] = bits >> (56 - 8 * i);
+
+    sha1_update(sha1, padding, count + 8);
+
+    for (int i=0; i<20; i++)
+        digest[i] = sha1->state[i / 4] >> (24 - 8 * (i % 4));
+}
+
+/*******************/
+/* Cache mechanism */
+/*******************/
+int checksum_compare(const void *a, const void *b, void *udata) {
+    const struct checksum *ua = a;
+    const struct checksum *ub = b;
+    return strcmp(ua->path, ub->path);
+}
+
+uint64_t checksum_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const char *path = item;
+    return hashmap_sip(path, strlen(path), seed0, seed1);
+}
+
+static void checksum_load() {
+    struct checksum checksum;
+    char sha1[41];
+    unsigned long long size;
+    long long mtime;
+    FILE *file = fopen(CHECKSUM_CACHE, "r");
+
+    if (!file)
+        return;
+
+    while (fscanf(file, "%8x %40s %llu %lld %1023[^\n]\n",
+                &checksum.crc32, sha1, &size, &mtime, checksum.path) == 5) {
+        for (int i=0; i<20; i++)
+            sscanf(sha1 + 2 * i, "%2hhx", checksum.sha1 + i);
+
+        checksum.size = size;
+        checksum.mtime = mtime;
+        hashmap_set(checksum_map, &checksum);
+    }
+
+    fclose(file);
+}
+
+static bool checksum_write(const void *item, void *udata) {
+    const struct checksum *checksum = item;
+    FILE *file = udata;
+
+    fprintf(file, "%08x ", checksum->crc32);
+    for (int i=0; i<20; i++)
+        fprintf(file, "%02x", checksum->sha1[i]);
+    fprintf(file, " %llu %lld %s\n",
+            (unsigned long long) checksum->size, (long long) checksum->mtime, checksum->path);
+
+    return true;
+}
+
+static void checksum_save() {
+    FILE *file = fopen(CHECKSUM_CACHE ".tmp", "w");
+
+    if (!file) {
+        printf("Error checksum_save : cannot write %s\n", CHECKSUM_CACHE ".tmp");
+        return;
+    }
+
+    SDL_LockMutex(checksum_lock);
+    hashmap_scan(checksum_map, checksum_write, file);
+    SDL_UnlockMutex(checksum_lock);
+
+    fclose(file);
+    rename(CHECKSUM_CACHE ".tmp", CHECKSUM_CACHE);
+}
+
+/************/
+/* Checksum */
+/************/
+static void checksum_sigbus(int signal) {
+    if (checksum_jump)
+        siglongjmp(*checksum_jump, 1);
+
+    /* Not raised while checksumming, crash as usual */
+    sigaction(SIGBUS, &(struct sigaction) { .sa_handler = SIG_DFL }, NULL);
+    raise(signal);
+}
+
+void checksum_init() {
+    if (checksum_map)
+        return;
+
+    crc32_init();
+
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+
+    /* SHA extensions are reported in leaf 7 */
+    sha1_ni_supported = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA)
+        && __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+#endif
+
+    sigaction(SIGBUS, &(struct sigaction) { .sa_handler = checksum_sigbus }, NULL);
+
+    checksum_lock = SDL_CreateMutex();
+    checksum_map = hashmap_new(sizeof(struct checksum), 0, 0, 0,
+            checksum_hash, checksum_compare, NULL, NULL);
+
+    checksum_load();
+}
+
+/* Returns 1 if the file was hashed, 0 if the cached result was used,
+ * -1 on error or if checksum_stop cancelled it */
+int checksum_file(const char *path, struct checksum *result) {
+    struct checksum *cached;
+    char key[PATH_MAX];
+    struct stat st;
+    struct sha1 sha1;
+    sigjmp_buf jump;
+    unsigned char *volatile data = NULL;
+    volatile size_t length = 0;
+    Uint64 offset;
+    Sint64 mtime;
+    size_t slice;
+    int fd;
+
+    /* Cached by canonical path so relative paths and symlinks share an entry */
+    if (!realpath(path, key)) {
+        printf("Error checksum_file : cannot resolve %s\n", path);
+        return -1;
+    }
+
+    if (strlen(key) >= CHECKSUM_PATH_LENGTH) {
+        printf("Error checksum_file : path too long %s\n", key);
+        return -1;
+    }
+
+    if (stat(key, &st) < 0) {
+        printf("Error checksum_file : cannot stat %s\n", path);
+        return -1;
+    }
+
+    /* Whole seconds would miss a rewrite within the second of the last one */
+    mtime = (Sint64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+    SDL_LockMutex(checksum_lock);
+    cached = hashmap_get(checksum_map, key);
+    if (cached && cached->size == (Uint64) st.st_size && cached->mtime == mtime) {
+        *result = *cached;
+        SDL_UnlockMutex(checksum_lock);
+        return 0;
+    }
+    SDL_UnlockMutex(checksum_lock);
+
+    fd = open(key, O_RDONLY);
+    if (fd < 0) {
+        printf("Error checksum_file : cannot open %s\n", path);
+        return -1;
+    }
+
+    strcpy(result->path, key);
+    result->size = st.st_size;
+    result->mtime = mtime;
+    result->crc32 = 0;
+    sha1_init(&sha1);
+
+    /* The file got shorter while mapped */
+    if (sigsetjmp(jump, 1)) {
+        checksum_jump = NULL;
+        printf("Error checksum_file : %s changed while reading\n", path);
+        if (data)
+            munmap(data, length);
+        close(fd);
+        return -1;
+    }
+
+    checksum_jump = &jump;
+
+    for (offset=0; offset<result->size; offset+=length) {
+        length = SDL_min(result->size - offset, CHECKSUM_WINDOW);
+        data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, offset);
+        if (data == MAP_FAILED) {
+            printf("Error checksum_file : cannot map %s\n", path);
+            data = NULL;
+            break;
+        }
+
+        madvise(data, length, MADV_SEQUENTIAL);
+
+        for (size_t i=0; i<length && !SDL_AtomicGet(&checksum_cancel); i+=slice) {
+            slice = SDL_min(length - i, CHECKSUM_SLICE);
+            result->crc32 = crc32_update(result->crc32, data + i, slice);
+            sha1_update(&sha1, data + i, slice);
+        }
+
+        munmap(data, length);
+        data = NULL;
+
+        if (SDL_AtomicGet(&checksum_cancel))
+            break;
+    }
+
+    checksum_jump = NULL;
+    close(fd);
+
+    /* Mapping failed or cancelled */
+    if (offset < result->size)
+        return -1;
+
+    sha1_final(&sha1, result->sha1);
+
+    SDL_LockMutex(checksum_lock);
+    hashmap_set(checksum_map, result);
+    SDL_UnlockMutex(checksum_lock);
+
+    return 1;
+}
+
+/**************/
+/* Batch tool */
+/**************/
+struct checksum_job {
+    char **files;
+    int count;
+    SDL_atomic_t next;
+    char verbose;
+    char low_priority;
+};
+
+struct checksum_worker {
+    struct checksum_job *job;
+    Uint64 bytes;
+    int hashed;
+    int errors;
+};
+
+static void checksum_collect(const char *path, char ***files, int *count, int *capacity) {
+    struct stat st;
+    struct dirent *entry;
+    char child[CHECKSUM_PATH_LENGTH];
+    DIR *dir;
+
+    if (stat(path, &st) < 0) {
+        printf("Error checksum_collect : cannot stat %s\n", path);
+        return;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        if (*count == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 256;
+            *files = realloc(*files, *capacity * sizeof(char *));
+        }
+
+        (*files)[(*count)++] = strdup(path);
+        return;
+    }
+
+    if (!S_ISDIR(st.st_mode) || !(dir = opendir(path)))
+        return;
+
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        if (snprintf(child, sizeof(child), "%s/%s", path, entry->d_name) >= (int) sizeof(child)) {
+            printf("Error checksum_collect : path too long in %s\n", path);
+            continue;
+        }
+
+        /* Symlinked directories may loop back, only files are followed */
+        if (lstat(child, &st) == 0 && S_ISLNK(st.st_mode)
+                && stat(child, &st) == 0 && S_ISDIR(st.st_mode))
+            continue;
+
+        checksum_collect(child, files, count, capacity);
+    }
+
+    closedir(dir);
+}
+
+static int checksum_thread(void *data) {
+    struct checksum_worker *worker = data;
+    struct checksum_job *job = worker->job;
+    struct checksum checksum;
+    char line[CHECKSUM_PATH_LENGTH + 64];
+    int i;
+
+    if (job->low_priority)
+        SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    while (!SDL_AtomicGet(&checksum_cancel) && (i = SDL_AtomicAdd(&job->next, 1)) < job->count) {
+        switch (checksum_file(job->files[i], &checksum)) {
+            case 1:
+                worker->bytes += checksum.size;
+                worker->hashed++;
+                /* Fall through */
+            case 0:
+                /* One write per line so workers do not interleave */
+                if (job->verbose) {
+                    snprintf(line, sizeof(line), "%08x ", checksum.crc32);
+                    for (int j=0; j<20; j++)
+                        snprintf(line + 9 + 2 * j, 3, "%02x", checksum.sha1[j]);
+                    snprintf(line + 49, sizeof(line) - 49, " %s\n", job->files[i]);
+                    fputs(line, stdout);
+                }
+                break;
+            default:
+                /* Files interrupted by checksum_stop are not errors */
+                if (!SDL_AtomicGet(&checksum_cancel))
+                    worker->errors++;
+                break;
+        }
+    }
+
+    return 0;
+}
+
+int checksum_threads(const char *path) {
+    struct stat st;
+    char sys[64];
+    FILE *file;
+    int rotational = 0;
+
+    if (stat(path, &st) == 0) {
+        /* Whole disks have a queue, partitions inherit their parent one */
+        snprintf(sys, sizeof(sys), "/sys/dev/block/%u:%u/queue/rotational", major(st.st_dev), minor(st.st_dev));
+        file = fopen(sys, "r");
+        if (!file) {
+            snprintf(sys, sizeof(sys), "/sys/dev/block/%u:%u/../queue/rotational", major(st.st_dev), minor(st.st_dev));
+            file = fopen(sys, "r");
+        }
+
+        if (file) {
+            if (fscanf(file, "%d", &rotational) != 1)
+                rotational = 0;
+            fclose(file);
+        }
+    }
+
+    /* Spinning disks are fastest read by a single sequential reader */
+    if (rotational)
+        return 1;
+
+    return SDL_max(SDL_GetCPUCount(), 1);
+}
+
+static int checksum_pool(char **paths, int count, int threads, char verbose, char low_priority) {
+    struct checksum_job job = { NULL, 0, { 0 }, verbose, low_priority };
+    int capacity = 0;
+    Uint64 start, bytes = 0;
+    int hashed = 0, errors = 0;
+    double elapsed;
+
+    checksum_init();
+
+    for (int i=0; i<count; i++)
+        checksum_collect(paths[i], &job.files, &job.count, &capacity);
+
+    if (threads <= 0)
+        threads = count > 0 ? checksum_threads(paths[0]) : 1;
+    threads = SDL_max(SDL_min(threads, job.count), 1);
+
+    SDL_Thread *handles[threads];
+    struct checksum_worker workers[threads];
+
+    start = SDL_GetPerformanceCounter();
+
+    /* This thread is the first worker */
+    for (int i=0; i<threads; i++) {
+        workers[i] = (struct checksum_worker) { &job, 0, 0, 0 };
+        handles[i] = i ? SDL_CreateThread(checksum_thread, "checksum", workers + i) : NULL;
+    }
+    checksum_thread(workers);
+
+    for (int i=0; i<threads; i++) {
+        if (handles[i])
+            SDL_WaitThread(handles[i], NULL);
+
+        bytes += workers[i].bytes;
+        hashed += workers[i].hashed;
+        errors += workers[i].errors;
+    }
+
+    elapsed = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    printf("Checksum : %d files, %d hashed, %d errors, %.2f GB in %.2f s (%.2f GB/s, %d threads)\n",
+            job.count, hashed, errors, bytes / 1e9, elapsed,
+            elapsed > 0 ? bytes / 1e9 / elapsed : 0, threads);
+
+    if (hashed)
+        checksum_save();
+
+    for (int i=0; i<job.count; i++)
+        free(job.files[i]);
+    free(job.files);
+
+    return errors ? -1 : 0;
+}
+
+int checksum_run(char **paths, int count, int threads, char verbose) {
+    return checksum_pool(paths, count, threads, verbose, 0);
+}
+
+/******************/
+/* Background job */
+/******************/
+static int checksum_background_thread(void *data) {
+    char *path = data;
+
+    /* A single low priority reader keeps the UI responsive */
+    checksum_pool(&path, 1, 1, 0, 1);
+    free(path);
+
+    return 0;
+}
+
+SDL_Thread *checksum_background(const char *path) {
+    struct stat st;
+
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    checksum_init();
+    SDL_AtomicSet(&checksum_cancel, 0);
+
+    return SDL_CreateThread(checksum_background_thread, "checksum", strdup(path));
+}
+
+void checksum_stop(SDL_Thread *thread) {
+    if (!thread)
+        return;
+
+    SDL_AtomicSet(&checksum_cancel, 1);
+    SDL_WaitThread(thread, NULL);
+}
@@ -0,0 +1,41 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <SDL2/SDL.h>
+
+#define CHECKSUM_PATH_LENGTH    1024
+#define CHECKSUM_CACHE          "checksums.cache"
+
+struct checksum {
+    char path[CHECKSUM_PATH_LENGTH];    /* Canonical, as returned by realpath */
+    Uint64 size;
+    Sint64 mtime;   /* Nanoseconds */
+    Uint32 crc32;
+    unsigned char sha1[20];
+};
+
+/************/
+/* Checksum */
+/************/
+void checksum_init();
+
+/* Checksum a file, reusing the cached result if its size and mtime did not change.
+ * Returns 1 if hashed, 0 if cached, -1 on error or cancellation */
+int checksum_file(const char *path, struct checksum *result);
+
+/**************/
+/* Batch tool */
+/**************/
+/* Number of threads worth running for the storage holding path */
+int checksum_threads(const char *path);
+
+/* Checksum every file under paths, threads is 0 to size the pool automatically */
+int checksum_run(char **paths, int count, int threads, char verbose);
+
+/******************/
+/* Background job */
+/******************/
+SDL_Thread *checksum_background(const char *path);
+void checksum_stop(SDL_Thread *thread);
+
+#endif
@@ -0,0 +1,372 @@
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "games.h"
+
+/* Below this many games, sorting is not worth spawning threads */
+#define PARALLEL_SORT_THRESHOLD 4096
+
+/******************/
+/* Collation keys */
+/******************/
+static int game_key(struct game *game) {
+    size_t length = strxfrm(NULL, game->title, 0);
+
+    game->key_prefix = 0;
+    game->key_length = 0;
+    game->key = malloc(length + 1);
+    if (!game->key)
+        return -1;
+
+    strxfrm((char *) game->key, game->title, length + 1);
+    game->key_length = length;
+
+    /* Pack the first bytes big-endian so most comparisons are one integer */
+    for (size_t i=0; i<sizeof(game->key_prefix); i++) {
+        game->key_prefix <<= 8;
+        if (i < length)
+            game->key_prefix |= game->key[i];
+    }
+
+    return 0;
+}
+
+static int game_compare(struct game_list *list, SORT_ORDER order, int a, int b) {
+    struct game *ga = list->games + a;
+    struct game *gb = list->games + b;
+    size_t length;
+    int result;
+
+    switch (order) {
+        case SORT_TITLE:
+            if (ga->key_prefix != gb->key_prefix)
+                return ga->key_prefix < gb->key_prefix ? -1 : 1;
+
+            length = ga->key_length < gb->key_length ? ga->key_length : gb->key_length;
+            result = memcmp(ga->key, gb->key, length);
+            if (result)
+                return result;
+
+            if (ga->key_length != gb->key_length)
+                return ga->key_length < gb->key_length ? -1 : 1;
+            break;
+        case SORT_YEAR:
+            if (ga->year != gb->year)
+                return ga->year < gb->year ? -1 : 1;
+            break;
+        case SORT_MOST_PLAYED:
+            if (ga->play_count != gb->play_count)
+                return ga->play_count > gb->play_count ? -1 : 1;
+            break;
+        case SORT_RECENTLY_ADDED:
+            if (ga->added != gb->added)
+                return ga->added > gb->added ? -1 : 1;
+            break;
+        default:
+            break;
+    }
+
+    /* Ties are broken by id so every order is total */
+    return (a > b) - (a < b);
+}
+
+/*****************/
+/* Parallel sort */
+/*****************/
+struct sort_job {
+    struct game_list *list;
+    SORT_ORDER order;
+    int *source;
+    int *destination;
+    int left;
+    int middle;
+    int right;
+};
+
+static void merge(struct sort_job *job) {
+    int i = job->left;
+    int j = job->middle;
+    int k = job->left;
+
+    while (i < job->middle && j < job->right) {
+        if (game_compare(job->list, job->order, job->source[i], job->source[j]) <= 0) {
+            job->destination[k++] = job->source[i++];
+        } else {
+            job->destination[k++] = job->source[j++];
+        }
+    }
+
+    while (i < job->middle)
+        job->destination[k++] = job->source[i++];
+
+    while (j < job->right)
+        job->destination[k++] = job->source[j++];
+}
+
+/* Bottom-up merge sort of [left, right), result is left in source */
+static int sort_thread(void *data) {
+    struct sort_job *job = data;
+    struct sort_job pass = *job;
+    int *swap;
+
+    for (int width=1; width<job->right-job->left; width*=2) {
+        for (int left=job->left; left<job->right; left+=2*width) {
+            pass.left = left;
+            pass.middle = SDL_min(left + width, job->right);
+            pass.right = SDL_min(left + 2 * width, job->right);
+            merge(&pass);
+        }
+
+        swap = pass.source;
+        pass.source = pass.destination;
+        pass.destination = swap;
+    }
+
+    if (pass.source != job->source)
+        memcpy(job->source + job->left, pass.source + job->left, (job->right - job->left) * sizeof(int));
+
+    return 0;
+}
+
+static int merge_thread(void *data) {
+    merge(data);
+    return 0;
+}
+
+static void run_jobs(SDL_ThreadFunction fn, struct sort_job *jobs, int count) {
+    SDL_Thread *threads[count];
+
+    for (int i=0; i<count; i++)
+        threads[i] = SDL_CreateThread(fn, "sort", jobs + i);
+
+    for (int i=0; i<count; i++) {
+        /* Do the work ourselves if the thread could not start */
+        if (threads[i]) {
+            SDL_WaitThread(threads[i], NULL);
+        } else {
+            fn(jobs + i);
+        }
+    }
+}
+
+static void sort_order(struct game_list *list, SORT_ORDER order, int *buffer) {
+    int *index = list->index[order];
+    int chunks = SDL_GetCPUCount();
+    int *swap;
+
+    for (int i=0; i<list->count; i++)
+        index[i] = i;
+
+    if (chunks < 1 || list->count < PARALLEL_SORT_THRESHOLD)
+        chunks = 1;
+
+    int bounds[chunks + 1];
+    struct sort_job jobs[chunks];
+
+    for (int i=0; i<=chunks; i++)
+        bounds[i] = (long) list->count * i / chunks;
+
+    /* Sort one chunk per core */
+    for (int i=0; i<chunks; i++)
+        jobs[i] = (struct sort_job) { list, order, index, buffer, bounds[i], 0, bounds[i + 1] };
+    run_jobs(sort_thread, jobs, chunks);
+
+    /* Merge chunks pairwise, each pair on its own core */
+    for (int width=1; width<chunks; width*=2) {
+        int count = 0;
+
+        for (int i=0; i<chunks; i+=2*width) {
+            jobs[count++] = (struct sort_job) {
+                list, order, index, buffer,
+                bounds[i],
+                bounds[SDL_min(i + width, chunks)],
+                bounds[SDL_min(i + 2 * width, chunks)]
+            };
+        }
+        run_jobs(merge_thread, jobs, count);
+
+        swap = index;
+        index = buffer;
+        buffer = swap;
+    }
+
+    if (index != list->index[order])
+        memcpy(list->index[order], index, list->count * sizeof(int));
+
+    for (int i=0; i<list->count; i++)
+        list->rank[order][list->index[order][i]] = i;
+}
+
+/********************/
+/* Incremental sort */
+/********************/
+/* Move a game whose fields changed to its new place in an order */
+static void reposition(struct game_list *list, SORT_ORDER order, int id) {
+    int *index = list->index[order];
+    int position = list->rank[order][id];
+    int target, low, high, middle;
+
+    if (position > 0 && game_compare(list, order, index[position - 1], id) > 0) {
+        /* First game ordered after this one, before its current position */
+        low = 0;
+        high = position - 1;
+        while (low < high) {
+            middle = (low + high) / 2;
+            if (game_compare(list, order, index[middle], id) > 0) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+
+        target = low;
+        memmove(index + target + 1, index + target, (position - target) * sizeof(int));
+        index[target] = id;
+
+        for (int i=target; i<=position; i++)
+            list->rank[order][index[i]] = i;
+    } else if (position < list->count - 1 && game_compare(list, order, id, index[position + 1]) > 0) {
+        /* Last game ordered before this one, after its current position */
+        low = position + 1;
+        high = list->count - 1;
+        while (low < high) {
+            middle = (low + high + 1) / 2;
+            if (game_compare(list, order, index[middle], id) < 0) {
+                low = middle;
+            } else {
+                high = middle - 1;
+            }
+        }
+
+        target = low;
+        memmove(index + position, index + position + 1, (target - position) * sizeof(int));
+        index[target] = id;
+
+        for (int i=position; i<=target; i++)
+            list->rank[order][index[i]] = i;
+    }
+}
+
+/*************/
+/* Game list */
+/*************/
+struct game_list *game_list_new() {
+    return calloc(1, sizeof(struct game_list));
+}
+
+void game_list_free(struct game_list *list) {
+    for (int i=0; i<list->count; i++)
+        free(list->games[i].key);
+
+    for (int i=0; i<SORT_COUNT; i++) {
+        free(list->index[i]);
+        free(list->rank[i]);
+    }
+
+    free(list->games);
+    free(list);
+}
+
+static int game_list_grow(struct game_list *list) {
+    int capacity = list->capacity ? list->capacity * 2 : 1024;
+    void *games;
+
+    games = realloc(list->games, capacity * sizeof(struct game));
+    if (!games)
+        return -1;
+    list->games = games;
+
+    for (int i=0; i<SORT_COUNT; i++) {
+        int *index = realloc(list->index[i], capacity * sizeof(int));
+        if (!index)
+            return -1;
+        list->index[i] = index;
+
+        int *rank = realloc(list->rank[i], capacity * sizeof(int));
+        if (!rank)
+            return -1;
+        list->rank[i] = rank;
+    }
+
+    list->capacity = capacity;
+
+    return 0;
+}
+
+int game_list_load(struct game_list *list, const char *title, int year, unsigned int play_count, Uint64 added) {
+    struct game *game;
+
+    if (list->count == list->capacity && game_list_grow(list) < 0) {
+        printf("Error game_list_load : out of memory\n");
+        return -1;
+    }
+
+    game = list->games + list->count;
+    snprintf(game->title, sizeof(game->title), "%s", title);
+    game->year = year;
+    game->play_count = play_count;
+    game->added = added;
+
+    if (game_key(game) < 0) {
+        printf("Error game_list_load : out of memory\n");
+        return -1;
+    }
+
+    return list->count++;
+}
+
+void game_list_sort(struct game_list *list) {
+    int *buffer;
+
+    if (!list->count)
+        return;
+
+    buffer = malloc(list->count * sizeof(int));
+    if (!buffer) {
+        printf("Error game_list_sort : out of memory\n");
+        return;
+    }
+
+    for (int i=0; i<SORT_COUNT; i++)
+        sort_order(list, i, buffer);
+
+    free(buffer);
+}
+
+int game_list_add(struct game_list *list, const char *title, int year, unsigned int play_count, Uint64 added) {
+    int id = game_list_load(list, title, year, play_count, added);
+
+    if (id < 0)
+        return -1;
+
+    /* Place the game last, then move it where it belongs */
+    for (int i=0; i<SORT_COUNT; i++) {
+        list->index[i][id] = id;
+        list->rank[i][id] = id;
+        reposition(list, i, id);
+    }
+
+    return id;
+}
+
+void game_list_played(struct game_list *list, int id) {
+    list->games[id].play_count++;
+    reposition(list, SORT_MOST_PLAYED, id);
+}
+
+void game_list_update(struct game_list *list, int id) {
+    struct game *game = list->games + id;
+
+    free(game->key);
+    if (game_key(game) < 0)
+        printf("Error game_list_update : out of memory\n");
+
+    for (int i=0; i<SORT_COUNT; i++)
+        reposition(list, i, id);
+}
+
+struct game *game_list_at(struct game_list *list, SORT_ORDER order, int position) {
+    return list->games + list->index[order][position];
+}
@@ -0,0 +1,58 @@
+#ifndef GAMES_H
+#define GAMES_H
+
+#include <SDL2/SDL.h>
+
+#define GAME_TITLE_LENGTH 255
+
+/***************/
+/* Sort orders */
+/***************/
+typedef enum {
+    SORT_TITLE,
+    SORT_YEAR,
+    SORT_MOST_PLAYED,
+    SORT_RECENTLY_ADDED,
+    SORT_COUNT,
+} SORT_ORDER;
+
+/*************/
+/* Game list */
+/*************/
+struct game {
+    char title[GAME_TITLE_LENGTH];
+    int year;
+    unsigned int play_count;
+    Uint64 added;
+
+    /* Collation key of the title in the LC_COLLATE locale, its first bytes packed in key_prefix */
+    Uint64 key_prefix;
+    unsigned char *key;
+    size_t key_length;
+};
+
+struct game_list {
+    struct game *games;
+    int count;
+    int capacity;
+
+    /* Game ids in each order, and position of each game in each order */
+    int *index[SORT_COUNT];
+    int *rank[SORT_COUNT];
+};
+
+struct game_list *game_list_new();
+void game_list_free(struct game_list *list);
+
+/* Append a game without ordering it, game_list_sort must be called after */
+int game_list_load(struct game_list *list, const char *title, int year, unsigned int play_count, Uint64 added);
+void game_list_sort(struct game_list *list);
+
+/* Append a game and insert it in every order */
+int game_list_add(struct game_list *list, const char *title, int year, unsigned int play_count, Uint64 added);
+void game_list_played(struct game_list *list, int id);
+void game_list_update(struct game_list *list, int id);
+
+struct game *game_list_at(struct game_list *list, SORT_ORDER order, int position);
+
+#endif
@@ -2,13 +2,20 @@
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "hashmap/hashmap.h"
+#include "checksum.h"
 
 const int SCREEN_WIDTH = 1280;
 const int SCREEN_HEIGHT = 1024;
 
+const char ROMS_PATH[] = "roms";
+
+#define FONT_PATH "BebasNeue-Regular.ttf"
+#define FONT_SIZE 32
+
 /*********************/
 /* Systems constants */
 /*********************/
@@ -54,6 +61,107 @@ struct system *previous_system() {
     return previous;
 }
 
+/***************/
+/* Frame pacer */
+/***************/
+#define DEFAULT_FRAME_RATE      60
+#define LATE_FRAME_THRESHOLD    1.5
+
+struct frame_pacer {
+    Uint64 origin;
+    double frequency;       /* Performance counter ticks per millisecond */
+    double period;          /* Expected time between two presents (ms) */
+    double last_present;    /* Time of the last present (ms) */
+    double next_present;    /* Predicted present of the frame being drawn (ms) */
+    char vsync;
+    char capped;            /* Without vsync, whether presents are capped */
+    unsigned long frames;
+    unsigned long late_frames;
+};
+
+struct frame_pacer frame_pacer = { 0, 1, 1000.0 / DEFAULT_FRAME_RATE, 0, 0, 1, 1, 0, 0 };
+
+double pacer_now() {
+    return (SDL_GetPerformanceCounter() - frame_pacer.origin) / frame_pacer.frequency;
+}
+
+/* max_fps caps the frame rate when vsync is off, 0 leaves it uncapped */
+void pacer_init(SDL_Window *window, SDL_Renderer *renderer, int max_fps) {
+    SDL_RendererInfo info;
+    SDL_DisplayMode mode;
+    int rate = DEFAULT_FRAME_RATE;
+
+    frame_pacer.origin = SDL_GetPerformanceCounter();
+    frame_pacer.frequency = SDL_GetPerformanceFrequency() / 1000.0;
+
+    frame_pacer.vsync = 0;
+    frame_pacer.capped = max_fps > 0;
+    if (SDL_GetRendererInfo(renderer, &info) == 0)
+        frame_pacer.vsync = (info.flags & SDL_RENDERER_PRESENTVSYNC) != 0;
+
+    if (frame_pacer.vsync) {
+        /* Presents are paced by the display */
+        if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0
+                && mode.refresh_rate > 0)
+            rate = mode.refresh_rate;
+    } else if (frame_pacer.capped) {
+        /* Presents are paced by us */
+        rate = max_fps;
+    }
+
+    /* Uncapped, the period is measured as frames are presented */
+
+    frame_pacer.period = 1000.0 / rate;
+    frame_pacer.last_present = pacer_now();
+    frame_pacer.next_present = frame_pacer.last_present + frame_pacer.period;
+}
+
+/* Predict when the frame about to be drawn will reach the screen, once so
+ * everything animated in the frame uses the same frame_pacer.next_present */
+void pacer_begin() {
+    double now = pacer_now();
+    double next = frame_pacer.last_present + frame_pacer.period;
+
+    /* Next slot already missed, aim for the following one */
+    if (now > next)
+        next += frame_pacer.period * SDL_ceil((now - next) / frame_pacer.period);
+
+    frame_pacer.next_present = next;
+}
+
+void pacer_present(SDL_Renderer *renderer) {
+    double target = frame_pacer.last_present + frame_pacer.period;
+    double now;
+
+    /* Without vsync, sleep until the frame slot, within a millisecond */
+    if (!frame_pacer.vsync && frame_pacer.capped) {
+        now = pacer_now();
+
+        if (target - now >= 1)
+            SDL_Delay(target - now);
+    }
+
+    SDL_RenderPresent(renderer);
+    now = pacer_now();
+
+    if (now - frame_pacer.last_present > frame_pacer.period * LATE_FRAME_THRESHOLD)
+        frame_pacer.late_frames++;
+
+    /* Uncapped, predict with a running average of the frame time */
+    if (!frame_pacer.vsync && !frame_pacer.capped)
+        frame_pacer.period = frame_pacer.period * 0.9 + (now - frame_pacer.last_present) * 0.1;
+
+    frame_pacer.frames++;
+    frame_pacer.last_present = now;
+
+    /* Capped and on time, keep to the slot so sleep overshoot does not add up */
+    if (!frame_pacer.vsync && frame_pacer.capped && now < target + frame_pacer.period)
+        frame_pacer.last_present = target;
+
+    /* Transitions started by input before the next frame begins */
+    frame_pacer.next_present = frame_pacer.last_present + frame_pacer.period;
+}
+
 /***************/
 /* Transitions */
 /***************/
@@ -81,7 +189,7 @@ int transitions_time[] = {
 
 struct transition {
     T_TRANSITION type;
-    int start;
+    double start;
     int duration;
     T_TRANSITION next;
 };
@@ -94,7 +202,7 @@ void next_transition(T_TRANSITION next) {
 
 void switch_transition(T_TRANSITION ttype, T_TRANSITION next) {
     current_transition.type = ttype;
-    current_transition.start = SDL_GetTicks();
+    current_transition.start = frame_pacer.next_present;
     current_transition.duration = transitions_time[ttype];
 
     if (next) {
@@ -129,6 +237,8 @@ struct hashmap *texture_map;
 struct cached_texture {
     char key[255];
     SDL_Texture *texture;
+    double ready;
+    char fading;
 };
 
 int texture_compare(const void *a, const void *b, void *udata) {
@@ -142,10 +252,184 @@ uint64_t texture_hash(const void *item, uint64_t seed0, uint64_t seed1) {
     return hashmap_sip(key, strlen(key), seed0, seed1);
 }
 
+#define FADE_IN_DURATION 200
+
+/* Fade textures in over their first frames */
+SDL_Texture *fadeTexture(struct cached_texture *texture) {
+    float alpha;
+
+    if (texture->fading) {
+        alpha = (frame_pacer.next_present - texture->ready) / FADE_IN_DURATION;
+
+        if (alpha >= 1) {
+            alpha = 1;
+            texture->fading = 0;
+        }
+
+        SDL_SetTextureAlphaMod(texture->texture, 255 * alpha);
+    }
+
+    return texture->texture;
+}
+
+/****************/
+/* Asset loader */
+/****************/
+#define ASSET_THREADS   4
+#define ASSET_UPLOADS   2
+#define ASSET_FIXED     6   /* Font, snap, three controls and flyer */
+
+typedef enum {
+    ASSET_PENDING,
+    ASSET_DECODED,
+    ASSET_READY,
+    ASSET_FAILED,
+} ASSET_STATE;
+
+struct asset {
+    char path[255];
+    char is_font;
+    SDL_Surface *surface;
+    TTF_Font *font;
+    SDL_atomic_t state;
+};
+
+/* Decoded in this order, the first ones are needed first */
+struct asset assets[ASSET_FIXED + sizeof(systems) / sizeof(systems[0])];
+int assets_count = 0;
+SDL_atomic_t assets_next;
+SDL_Thread *assets_threads[ASSET_THREADS];
+
+void add_asset(char *path, char is_font) {
+    struct asset *asset;
+    struct cached_texture placeholder = { "", NULL, 0, 0 };
+
+    if (assets_count == (int) (sizeof(assets) / sizeof(assets[0]))) {
+        printf("Error add_asset : too many assets, %s not loaded\n", path);
+        return;
+    }
+    asset = assets + assets_count++;
+
+    strcpy(asset->path, path);
+    asset->is_font = is_font;
+    SDL_AtomicSet(&asset->state, ASSET_PENDING);
+
+    /* Images are not drawn until their placeholder gets a texture */
+    if (!is_font) {
+        strcpy(placeholder.key, path);
+        hashmap_set(texture_map, &placeholder);
+    }
+}
+
+int asset_thread(void *data) {
+    struct asset *asset;
+    int i;
+
+    while ((i = SDL_AtomicAdd(&assets_next, 1)) < assets_count) {
+        asset = assets + i;
+
+        if (asset->is_font) {
+            asset->font = TTF_OpenFont(asset->path, FONT_SIZE);
+        } else {
+            asset->surface = IMG_Load(asset->path);
+        }
+
+        if (!asset->font && !asset->surface)
+            printf("Error asset_thread : cannot load %s\n", asset->path);
+
+        SDL_AtomicSet(&asset->state, asset->font || asset->surface ? ASSET_DECODED : ASSET_FAILED);
+    }
+
+    return 0;
+}
+
+void assets_init() {
+    struct system *system = current_system;
+    char path[255];
+    int threads = SDL_min(SDL_max(SDL_GetCPUCount(), 1), ASSET_THREADS);
+
+    add_asset(FONT_PATH, 1);
+    add_asset("snap.png", 0);
+    add_asset("controls/left_right.png", 0);
+    add_asset("controls/up_down.png", 0);
+    add_asset("controls/a.png", 0);
+
+    /* Current system logo first, then the following ones */
+    do {
+        snprintf(path, sizeof(path), "systems/%s.png", system->name);
+        add_asset(path, 0);
+
+        system += 1;
+        if (system >= systems + (sizeof(systems) / sizeof(systems[0])))
+            system = systems;
+    } while (system != current_system);
+
+    add_asset("flyer.png", 0);
+
+    for (int i=0; i<threads; i++)
+        assets_threads[i] = SDL_CreateThread(asset_thread, "assets", NULL);
+
+    /* Load everything ourselves if no thread could start */
+    if (!assets_threads[0])
+        asset_thread(NULL);
+}
+
+/* Turn decoded images into textures, returns the number of assets not ready */
+int assets_upload(SDL_Renderer *renderer) {
+    struct cached_texture *texture;
+    struct asset *asset;
+    int uploads = 0;
+    int pending = 0;
+
+    for (int i=0; i<assets_count; i++) {
+        asset = assets + i;
+
+        switch (SDL_AtomicGet(&asset->state)) {
+            case ASSET_PENDING:
+                pending++;
+                break;
+            case ASSET_DECODED:
+                if (asset->surface) {
+                    /* Spread uploads over frames */
+                    if (uploads == ASSET_UPLOADS) {
+                        pending++;
+                        break;
+                    }
+
+                    texture = hashmap_get(texture_map, asset->path);
+                    texture->texture = SDL_CreateTextureFromSurface(renderer, asset->surface);
+                    texture->ready = frame_pacer.next_present;
+                    texture->fading = 1;
+
+                    SDL_FreeSurface(asset->surface);
+                    asset->surface = NULL;
+                    uploads++;
+                }
+
+                SDL_AtomicSet(&asset->state, ASSET_READY);
+                break;
+        }
+    }
+
+    return pending;
+}
+
+void assets_quit() {
+    for (int i=0; i<ASSET_THREADS; i++) {
+        if (assets_threads[i])
+            SDL_WaitThread(assets_threads[i], NULL);
+    }
+
+    for (int i=0; i<assets_count; i++)
+        SDL_FreeSurface(assets[i].surface);
+}
+
 /*****************/
 /* SDL functions */
 /*****************/
-int init(SDL_Window **window, SDL_Renderer **renderer) {
+int init(SDL_Window **window, SDL_Renderer **renderer, char vsync) {
+    Uint32 flags = SDL_RENDERER_ACCELERATED;
+
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         printf("Error SDL_Init : %s\n", SDL_GetError());
         return -1;
@@ -164,7 +448,10 @@ int init(SDL_Window **window, SDL_Renderer **renderer) {
         return -1;
     }
 
-    *renderer = SDL_CreateRenderer(*window, -1, SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_ACCELERATED);
+    if (vsync)
+        flags |= SDL_RENDERER_PRESENTVSYNC;
+
+    *renderer = SDL_CreateRenderer(*window, -1, flags);
     SDL_SetRenderDrawBlendMode(*renderer, SDL_BLENDMODE_BLEND);
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "2");
 
@@ -195,30 +482,51 @@ SDL_Texture *loadImage(SDL_Renderer *renderer, char *path) {
         texture = malloc(sizeof(struct cached_texture));
         strcpy(texture->key, path);
         texture->texture = SDL_CreateTextureFromSurface(renderer, surface);
+        texture->fading = 0;
         hashmap_set(texture_map, texture);
 
 
         SDL_FreeSurface(surface);
     }
 
-    return texture->texture;
+    /* Assets still loading have no texture yet */
+    if (!texture->texture)
+        return NULL;
+
+    return fadeTexture(texture);
 }
 
 SDL_Texture *loadText(SDL_Renderer *renderer, char *text, TTF_Font *font, SDL_Color color) {
     struct cached_texture *texture = hashmap_get(texture_map, text);
 
+    if (!font)
+        return NULL;
+
     if (!texture) {
         SDL_Surface *surface = TTF_RenderUTF8_Blended(font, text, color);
 
         texture = malloc(sizeof(struct cached_texture));
         strcpy(texture->key, text);
         texture->texture = SDL_CreateTextureFromSurface(renderer, surface);
+        texture->ready = frame_pacer.next_present;
+        texture->fading = 1;
         hashmap_set(texture_map, texture);
 
         SDL_FreeSurface(surface);
+        texture = hashmap_get(texture_map, text);
     }
 
-    return texture->texture;
+    return fadeTexture(texture);
+}
+
+TTF_Font *loadFont(char *path) {
+    for (int i=0; i<assets_count; i++) {
+        if (assets[i].is_font && strcmp(assets[i].path, path) == 0
+                && SDL_AtomicGet(&assets[i].state) == ASSET_READY)
+            return assets[i].font;
+    }
+
+    return NULL;
 }
 
 SDL_Texture *createTexture(SDL_Renderer *renderer, char *name, int width, int height) {
@@ -227,6 +535,7 @@ SDL_Texture *createTexture(SDL_Renderer *renderer, char *name, int width, int he
     if (!texture) {
         texture = malloc(sizeof(struct cached_texture));
         strcpy(texture->key, name);
+        texture->fading = 0;
         texture->texture = SDL_CreateTexture(
                 renderer,
                 SDL_PIXELFORMAT_RGBA8888,
@@ -278,6 +587,9 @@ void SDL_Copy(
         int rotate, int flags) {
     SDL_Rect srcrect, dstrect;
 
+    if (!texture)
+        return;
+
     srcrect.x = 0;
     srcrect.y = 0;
 
@@ -590,32 +902,77 @@ void drawConveyor(SDL_Renderer *renderer, TTF_Font *font, float progress) {
 /*************/
 /* Main loop */
 /*************/
-int main(int argc, char *argv) {
+int main(int argc, char **argv) {
+    Uint64 boot = SDL_GetPerformanceCounter();
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *picture;
-    TTF_Font *font;
+    SDL_Thread *checksum_thread = NULL;
+    TTF_Font *font = NULL;
     SDL_Event e;
     char exit = 0;
     float progress;
+    char vsync = 1;
+    int max_fps = DEFAULT_FRAME_RATE;
+    int threads = 0;
+    char interactive = 0;
+    char *end;
+
+    /* Parse arguments */
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--no-vsync") == 0) {
+            vsync = 0;
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            /* Only used with --no-vsync, 0 disables the cap */
+            max_fps = strtol(argv[++i], &end, 10);
+            if (*end || end == argv[i] || max_fps < 0) {
+                printf("Error --fps : expected a frame rate >= 0, got %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--checksum") == 0) {
+            /* Batch mode, remaining arguments are the files to checksum */
+            return checksum_run(argv + i + 1, argc - i - 1, threads, 1) < 0;
+        }
+    }
 
-    if (init(&window, &renderer) == 0) {
+    if (init(&window, &renderer, vsync) == 0) {
         /* Initialize maps */
         texture_map = hashmap_new(sizeof(struct cached_texture), 0, 0, 0,
                 texture_hash, texture_compare, NULL, NULL);
 
-        picture = loadImage(renderer, "snap.png");
-        font = TTF_OpenFont("BebasNeue-Regular.ttf", 32);
+        /* Draw a first frame right away, assets fade in as they load */
+        pacer_init(window, renderer, max_fps);
+        assets_init();
 
         while (!exit) {
-            progress = ((float) SDL_GetTicks() - current_transition.start) / current_transition.duration;
+            pacer_begin();
+
+            if (!interactive && assets_upload(renderer) == 0) {
+                interactive = 1;
+                printf("Startup : interactive after %.1f ms\n",
+                        (double) (SDL_GetPerformanceCounter() - boot) * 1000 / SDL_GetPerformanceFrequency());
+
+                /* Checksum ROMs in the background for metadata matching */
+                checksum_thread = checksum_background(ROMS_PATH);
+            }
+
+            if (!font)
+                font = loadFont(FONT_PATH);
+
+            /* Animate against the time the frame will be shown */
+            progress = (frame_pacer.next_present - current_transition.start) / current_transition.duration;
 
             if (progress > 1)
                 progress = 1;
 
+            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
             SDL_RenderClear(renderer);
-            
-            SDL_RenderCopy(renderer, picture, NULL, NULL);
+
+            picture = loadImage(renderer, "snap.png");
+            if (picture)
+                SDL_RenderCopy(renderer, picture, NULL, NULL);
 
             /* Draw conveyor */
             switch (current_transition.type) {
@@ -651,7 +1008,11 @@ int main(int argc, char *argv) {
                     drawCorner(renderer, 0);
             }
 
-            SDL_RenderPresent(renderer);
+            pacer_present(renderer);
+
+            if (frame_pacer.frames == 1)
+                printf("Startup : first frame after %.1f ms\n",
+                        (double) (SDL_GetPerformanceCounter() - boot) * 1000 / SDL_GetPerformanceFrequency());
 
             /* Next transition */
             if (progress == 1) {
@@ -741,6 +1102,11 @@ int main(int argc, char *argv) {
                 }
             }
         }
+
+        checksum_stop(checksum_thread);
+        assets_quit();
+
+        printf("Frames : %lu, late : %lu\n", frame_pacer.frames, frame_pacer.late_frames);
     }
 
     quit(window, renderer);